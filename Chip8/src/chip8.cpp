@@ -1,8 +1,10 @@
 #include "chip8.hpp"
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <cstdlib>
 #include <fstream>
-#include <random>
+#include <vector>
 
 std::array<unsigned char, 80> chip8_fontset =
 {
@@ -24,6 +26,27 @@ std::array<unsigned char, 80> chip8_fontset =
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// 8x10 hi-res digits for Fx30
+std::array<unsigned char, 160> chip8_big_fontset =
+{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
 Chip8& Chip8::get()
 {
   static Chip8 instance;
@@ -37,7 +60,7 @@ Chip8::Chip8()
 
 // START DECLARATIONS
 
-std::array<unsigned char, 4096>     Chip8::memory;
+std::array<std::shared_ptr<memory_page>, CHIP8_PAGE_COUNT>       Chip8::memory;
 std::array<unsigned char, 16>       Chip8::V;
 std::array<unsigned short, 16>      Chip8::stack;
 
@@ -47,8 +70,22 @@ unsigned short                      Chip8::sp;
 
 unsigned char                       Chip8::delay_timer;
 unsigned char                       Chip8::sound_timer;
+unsigned char                       Chip8::waiting_key;
+unsigned int                        Chip8::random_state;
+
+bool                                Chip8::hires;
+unsigned char                       Chip8::plane_mask;
+std::array<unsigned char, 16>       Chip8::flags;
+std::array<unsigned char, 16>       Chip8::audio_pattern;
+unsigned char                       Chip8::pitch;
+
+int                                 Chip8::variant = CHIP8_VARIANT_CHIP8;
+unsigned short                      Chip8::memory_mask = 4096 - 1;
 
-std::array<unsigned char, 64 * 32>  Chip8::graphics;
+native_function                     Chip8::native;
+std::bitset<CHIP8_MEMORY_SIZE>      Chip8::code_dirty;
+
+std::array<std::shared_ptr<display_row>, CHIP8_DISPLAY_HEIGHT>    Chip8::graphics;
 std::array<unsigned char, 16>       Chip8::keys;
 
 unsigned char                       Chip8::render_flag; // Currently not used since display constantly renders at 60 Hz
@@ -57,11 +94,12 @@ unsigned char                       Chip8::render_flag; // Currently not used si
 
 void Chip8::reset()
 {
-  std::fill(memory.begin(), memory.end(), 0);
+  // Every page and row starts out pointing at the same blank copy, they get split off on first write
+  std::fill(memory.begin(), memory.end(), std::make_shared<memory_page>());
+  std::fill(graphics.begin(), graphics.end(), std::make_shared<display_row>());
   std::fill(V.begin(), V.end(), 0);
   std::fill(stack.begin(), stack.end(), 0);
   std::fill(keys.begin(), keys.end(), 0);
-  std::fill(graphics.begin(), graphics.end(), 0);
 
   I = 0;
   pc = 0x200;
@@ -69,37 +107,274 @@ void Chip8::reset()
 
   delay_timer = 0;
   sound_timer = 0;
+  waiting_key = 0xFF;
+  random_state = 0x2545F491;
+
+  hires = false;
+  plane_mask = 0x1;
+  std::fill(flags.begin(), flags.end(), 0);
+  std::fill(audio_pattern.begin(), audio_pattern.end(), 0);
+  pitch = 64;
+
+  // Load fontsets in memory
+  for (size_t i = 0; i < chip8_fontset.size(); ++i)
+  {
+    write_byte(0x50 + i, chip8_fontset[i]);
+  }
+  for (size_t i = 0; i < chip8_big_fontset.size(); ++i)
+  {
+    write_byte(0xA0 + i, chip8_big_fontset[i]);
+  }
 
-  // Load fontset in memory
-  std::copy(chip8_fontset.begin(), chip8_fontset.end(), memory.begin() + 0x50);
+  native = nullptr;
+  code_dirty.reset();
 
   return;
 }
 
+/*
+Returns the page containing address, copying it first if it is shared with a saved state
+*/
+memory_page& Chip8::writable_page(unsigned short address)
+{
+  std::shared_ptr<memory_page>& page = memory[(address % CHIP8_MEMORY_SIZE) / CHIP8_PAGE_SIZE];
+  if (page.use_count() > 1)
+  {
+    page = std::make_shared<memory_page>(*page);
+  }
+  return *page;
+}
+
+/*
+Returns the display row, copying it first if it is shared with a saved state
+*/
+display_row& Chip8::writable_row(unsigned char row)
+{
+  std::shared_ptr<display_row>& display = graphics[row % CHIP8_DISPLAY_HEIGHT];
+  if (display.use_count() > 1)
+  {
+    display = std::make_shared<display_row>(*display);
+  }
+  return *display;
+}
+
+/*
+Snapshots the machine. Only reference counts are touched, so this is cheap enough to call every frame.
+*/
+Chip8State Chip8::save_state()
+{
+  Chip8State state;
+  state.memory = memory;
+  state.graphics = graphics;
+  state.V = V;
+  state.stack = stack;
+  state.I = I;
+  state.pc = pc;
+  state.sp = sp;
+  state.delay_timer = delay_timer;
+  state.sound_timer = sound_timer;
+  state.waiting_key = waiting_key;
+  state.random_state = random_state;
+  state.hires = hires;
+  state.plane_mask = plane_mask;
+  state.flags = flags;
+  state.audio_pattern = audio_pattern;
+  state.pitch = pitch;
+  return state;
+}
+
+/*
+Puts the machine back into a previously saved state. The state stays valid and can be restored again.
+*/
+void Chip8::restore_state(const Chip8State& state)
+{
+  memory = state.memory;
+  graphics = state.graphics;
+  V = state.V;
+  stack = state.stack;
+  I = state.I;
+  pc = state.pc;
+  sp = state.sp;
+  delay_timer = state.delay_timer;
+  sound_timer = state.sound_timer;
+  waiting_key = state.waiting_key;
+  random_state = state.random_state;
+  hires = state.hires;
+  plane_mask = state.plane_mask;
+  flags = state.flags;
+  audio_pattern = state.audio_pattern;
+  pitch = state.pitch;
+  render_flag = 1;
+}
+
+/*
+Selects the instruction set quirks and memory size, takes effect on the next load
+*/
+void Chip8::set_variant(int machine_variant)
+{
+  variant = machine_variant;
+  memory_mask = (variant == CHIP8_VARIANT_XOCHIP ? 65536 : 4096) - 1;
+}
+
+int Chip8::display_width()
+{
+  return hires ? CHIP8_DISPLAY_WIDTH : CHIP8_LORES_WIDTH;
+}
+
+int Chip8::display_height()
+{
+  return hires ? CHIP8_DISPLAY_HEIGHT : CHIP8_LORES_HEIGHT;
+}
+
 int Chip8::load(const char* file_path)
 {
   reset();
   std::ifstream file(file_path, std::ios::binary | std::ios::ate);
   std::streamsize size = file.tellg();
 
-  if (size > sizeof(memory) - 0x200)
+  if (size < 0 || size > memory_mask + 1 - 0x200)
   {
     std::cout << "ROM too big to fit in memory, or does not exist." << std::endl;
     return -1;
   }
 
+  std::vector<char> rom(size);
   file.seekg(0, std::ios::beg);
-  if (!file.read(reinterpret_cast<char*>(memory.data() + 0x200), size))
+  if (!file.read(rom.data(), size))
   {
     std::cout << "Failed to read file into memory!" << std::endl;
     return -1;
   }
 
+  for (std::streamsize i = 0; i < size; ++i)
+  {
+    write_byte(0x200 + i, rom[i]);
+  }
+  code_dirty.reset();
+
   printf("Read ROM: %s with size %lld \n", file_path, size);
 
+  auto native_iterator = native_registry().find(chip8_rom_hash(reinterpret_cast<unsigned char*>(rom.data()), size));
+  if (native_iterator != native_registry().end())
+  {
+    native = native_iterator->second;
+    printf("Running compiled code for ROM \n");
+  }
+
   return 0;
 }
 
+/*
+Skips the next instruction. XO-CHIP's F000 NNNN is 4 bytes long and is skipped as a whole.
+*/
+void Chip8::skip_instruction()
+{
+  if (variant == CHIP8_VARIANT_XOCHIP && read_byte(pc) == 0xF0 && read_byte(pc + 1) == 0x00)
+  {
+    pc += 4;
+  }
+  else
+  {
+    pc += 2;
+  }
+}
+
+/*
+Whether clearing or scrolling may treat rows as a whole. Only XO-CHIP can draw to the second plane,
+so in the other variants selecting just the first plane is the same as selecting both.
+*/
+bool Chip8::all_planes_selected()
+{
+  return plane_mask == 0x3 || variant != CHIP8_VARIANT_XOCHIP;
+}
+
+/*
+Moves the selected planes down by rows (up if negative). When every plane moves the rows are
+shared pointers, so this only shuffles pointers.
+*/
+void Chip8::scroll_vertical(int rows)
+{
+  int height = display_height();
+  if (all_planes_selected())
+  {
+    std::shared_ptr<display_row> blank = std::make_shared<display_row>();
+    if (rows > 0)
+    {
+      rows = std::min(rows, height);
+      std::move_backward(graphics.begin(), graphics.begin() + height - rows, graphics.begin() + height);
+      std::fill(graphics.begin(), graphics.begin() + rows, blank);
+    }
+    else
+    {
+      rows = std::min(-rows, height);
+      std::move(graphics.begin() + rows, graphics.begin() + height, graphics.begin());
+      std::fill(graphics.begin() + height - rows, graphics.begin() + height, blank);
+    }
+    return;
+  }
+
+  // Only some planes move, copy their words row by row in the direction that does not overwrite the source
+  for (int i = 0; i < height; ++i)
+  {
+    int row = rows > 0 ? height - 1 - i : i;
+    int source = row - rows;
+    for (int plane = 0; plane < CHIP8_DISPLAY_PLANES; ++plane)
+    {
+      if (!(plane_mask & (1 << plane)))
+      {
+        continue;
+      }
+      for (int word = 0; word < CHIP8_ROW_WORDS; ++word)
+      {
+        int index = plane * CHIP8_ROW_WORDS + word;
+        std::uint64_t bits = (source >= 0 && source < height) ? (*graphics[source])[index] : 0;
+        if ((*graphics[row])[index] != bits)
+        {
+          writable_row(row)[index] = bits;
+        }
+      }
+    }
+  }
+}
+
+/*
+Moves the selected planes right by pixels (left if negative), a word shift per row and plane
+*/
+void Chip8::scroll_horizontal(int pixels)
+{
+  int words = display_width() / 64;
+  for (int row = 0; row < display_height(); ++row)
+  {
+    for (int plane = 0; plane < CHIP8_DISPLAY_PLANES; ++plane)
+    {
+      std::uint64_t* current = &(*graphics[row])[plane * CHIP8_ROW_WORDS];
+      if (!(plane_mask & (1 << plane)) || (!current[0] && !current[words - 1]))
+      {
+        continue; // Blank rows stay shared
+      }
+
+      std::uint64_t* bits = &writable_row(row)[plane * CHIP8_ROW_WORDS];
+      if (pixels > 0)
+      {
+        for (int word = words - 1; word > 0; --word)
+        {
+          bits[word] = (bits[word] >> pixels) | (bits[word - 1] << (64 - pixels));
+        }
+        bits[0] >>= pixels;
+      }
+      else
+      {
+        for (int word = 0; word < words - 1; ++word)
+        {
+          bits[word] = (bits[word] << -pixels) | (bits[word + 1] >> (64 + pixels));
+        }
+        bits[words - 1] <<= -pixels;
+      }
+    }
+  }
+  render_flag = 1;
+}
+
 void Chip8::op_default(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
   // Do nothing
@@ -112,7 +387,65 @@ void Chip8::op_0nnn(unsigned short opcode, unsigned char x, unsigned char y, uns
 
 void Chip8::op_00e0(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
-  std::fill(graphics.begin(), graphics.end(), 0);
+  if (all_planes_selected())
+  {
+    std::fill(graphics.begin(), graphics.end(), std::make_shared<display_row>());
+  }
+  else
+  {
+    for (int row = 0; row < CHIP8_DISPLAY_HEIGHT; ++row)
+    {
+      for (int plane = 0; plane < CHIP8_DISPLAY_PLANES; ++plane)
+      {
+        if (plane_mask & (1 << plane))
+        {
+          std::uint64_t* bits = &writable_row(row)[plane * CHIP8_ROW_WORDS];
+          std::fill(bits, bits + CHIP8_ROW_WORDS, 0);
+        }
+      }
+    }
+  }
+  render_flag = 1;
+}
+
+void Chip8::op_00cn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  scroll_vertical(opcode & 0x000F);
+  render_flag = 1;
+}
+
+void Chip8::op_00dn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  scroll_vertical(-(opcode & 0x000F));
+  render_flag = 1;
+}
+
+void Chip8::op_00fb(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  scroll_horizontal(4);
+}
+
+void Chip8::op_00fc(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  scroll_horizontal(-4);
+}
+
+void Chip8::op_00fd(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  pc -= 2; // Exit, stay on this instruction forever
+}
+
+void Chip8::op_00fe(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  hires = false;
+  std::fill(graphics.begin(), graphics.end(), std::make_shared<display_row>());
+  render_flag = 1;
+}
+
+void Chip8::op_00ff(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  hires = true;
+  std::fill(graphics.begin(), graphics.end(), std::make_shared<display_row>());
   render_flag = 1;
 }
 
@@ -138,7 +471,7 @@ void Chip8::op_3xkk(unsigned short opcode, unsigned char x, unsigned char y, uns
 {
   if (V[x] == val)
   {
-    pc += 2;
+    skip_instruction();
   }
 }
 
@@ -146,7 +479,7 @@ void Chip8::op_4xkk(unsigned short opcode, unsigned char x, unsigned char y, uns
 {
   if (V[x] != val)
   {
-    pc += 2;
+    skip_instruction();
   }
 }
 
@@ -154,7 +487,25 @@ void Chip8::op_5xy0(unsigned short opcode, unsigned char x, unsigned char y, uns
 {
   if (V[x] != val)
   {
-    pc += 2;
+    skip_instruction();
+  }
+}
+
+void Chip8::op_5xy2(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  int step = x <= y ? 1 : -1;
+  for (int i = 0; i <= std::abs(y - x); ++i)
+  {
+    write_byte(I + i, V[x + i * step]);
+  }
+}
+
+void Chip8::op_5xy3(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  int step = x <= y ? 1 : -1;
+  for (int i = 0; i <= std::abs(y - x); ++i)
+  {
+    V[x + i * step] = read_byte(I + i);
   }
 }
 
@@ -226,7 +577,7 @@ void Chip8::op_9xy0(unsigned short opcode, unsigned char x, unsigned char y, uns
 {
   if (V[x] != V[y])
   {
-    pc += 2;
+    skip_instruction();
   }
 }
 
@@ -242,31 +593,97 @@ void Chip8::op_bnnn(unsigned short opcode, unsigned char x, unsigned char y, uns
 
 void Chip8::op_cxkk(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
-  unsigned char random_byte = rand() % 0x100;
+  // xorshift32, so the sequence can be saved and restored with the rest of the machine
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  unsigned char random_byte = random_state % 0x100;
   V[x] = random_byte & val;
 }
 
+/*
+Part of a sprite that lands in a 64-bit display word, for a sprite left aligned in a word
+starting offset pixels into the display word (negative if it starts in an earlier word)
+*/
+static std::uint64_t sprite_word(std::uint64_t sprite, int offset)
+{
+  if (offset >= 64 || offset <= -64)
+  {
+    return 0;
+  }
+  return offset >= 0 ? sprite >> offset : sprite << -offset;
+}
+
 void Chip8::op_dxyn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
   unsigned char n = opcode & 0x000F;
 
-  unsigned char x_coord = V[x];
-  unsigned char y_coord = V[y];
+  int width = display_width();
+  int height = display_height();
+  bool wrap = variant == CHIP8_VARIANT_CHIP8;
+
+  // Dxy0 draws a 16x16 sprite on SUPER-CHIP and XO-CHIP
+  int sprite_width = 8;
+  int sprite_height = n;
+  if (n == 0 && variant != CHIP8_VARIANT_CHIP8)
+  {
+    sprite_width = 16;
+    sprite_height = 16;
+  }
+
+  int x_coord = V[x] % width;
+  int y_coord = V[y] % height;
 
   V[0xF] = 0;
 
-  for (int y_pixel = 0; y_pixel < n; y_pixel++)
+  // Each selected plane takes its own sprite data, one after the other
+  unsigned short address = I;
+  for (int plane = 0; plane < CHIP8_DISPLAY_PLANES; ++plane)
   {
-    unsigned char sprite_row = memory[I + y_pixel];
-    for (int x_pixel = 0; x_pixel < 8; x_pixel++)
+    if (!(plane_mask & (1 << plane)))
     {
-      if (sprite_row & (0x80 >> x_pixel)) // Pixel on sprite is set
+      continue;
+    }
+
+    for (int y_pixel = 0; y_pixel < sprite_height; ++y_pixel)
+    {
+      unsigned int sprite_row = read_byte(address);
+      if (sprite_width == 16)
       {
-        if (graphics[((y_coord + y_pixel) % 32) * 64 + ((x_coord + x_pixel) % 64)]) // Pixel on display is set
+        sprite_row = (sprite_row << 8) | read_byte(address + 1);
+      }
+      address += sprite_width / 8;
+
+      int row_y = y_coord + y_pixel;
+      if (row_y >= height)
+      {
+        if (!wrap)
+        {
+          continue;
+        }
+        row_y -= height;
+      }
+
+      if (!sprite_row) // Nothing to draw, leave the row shared
+      {
+        continue;
+      }
+
+      std::uint64_t sprite = static_cast<std::uint64_t>(sprite_row) << (64 - sprite_width);
+      std::uint64_t* bits = &writable_row(row_y)[plane * CHIP8_ROW_WORDS];
+      for (int word = 0; word < width / 64; ++word)
+      {
+        std::uint64_t drawn = sprite_word(sprite, x_coord - word * 64);
+        if (wrap) // Pixels past the right edge come back on the left
+        {
+          drawn |= sprite_word(sprite, x_coord - width - word * 64);
+        }
+
+        if (bits[word] & drawn) // Pixel on display is set
         {
           V[0xF] = 1;
         }
-        graphics[((y_coord + y_pixel) % 32) * 64 + ((x_coord + x_pixel) % 64)] ^= 0xFF;
+        bits[word] ^= drawn;
       }
     }
   }
@@ -278,7 +695,7 @@ void Chip8::op_ex9e(unsigned short opcode, unsigned char x, unsigned char y, uns
 {
   if (keys[V[x]])
   {
-    pc += 2;
+    skip_instruction();
   }
 }
 
@@ -286,7 +703,26 @@ void Chip8::op_exa1(unsigned short opcode, unsigned char x, unsigned char y, uns
 {
   if (!keys[V[x]])
   {
-    pc += 2;
+    skip_instruction();
+  }
+}
+
+void Chip8::op_f000(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  I = read_byte(pc) << 8 | read_byte(pc + 1);
+  pc += 2;
+}
+
+void Chip8::op_fn01(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  plane_mask = x & 0x3;
+}
+
+void Chip8::op_f002(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  for (int i = 0; i < 16; ++i)
+  {
+    audio_pattern[i] = read_byte(I + i);
   }
 }
 
@@ -297,24 +733,23 @@ void Chip8::op_fx07(unsigned short opcode, unsigned char x, unsigned char y, uns
 
 void Chip8::op_fx0a(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
-  static unsigned char key = 0xFF;
-  if (key == 0xFF)
+  if (waiting_key == 0xFF)
   {
     for (int i = 0; i < 16; ++i)
     {
       if (keys[i]) // Key is held down, save it, and wait until it is released
       {
-        key = i;
+        waiting_key = i;
       }
     }
     pc -= 2;
   }
   else
   {
-    if (!keys[key]) // Key is released, we can stop waiting and save the key
+    if (!keys[waiting_key]) // Key is released, we can stop waiting and save the key
     {
-      V[x] = key;
-      key = 0xFF;
+      V[x] = waiting_key;
+      waiting_key = 0xFF;
     }
   }
 }
@@ -339,21 +774,47 @@ void Chip8::op_fx29(unsigned short opcode, unsigned char x, unsigned char y, uns
   I = 0x50 + (V[x] * 5);
 }
 
+void Chip8::op_fx30(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  I = 0xA0 + ((V[x] & 0xF) * 10);
+}
+
+void Chip8::op_fx3a(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  pitch = V[x];
+}
+
 void Chip8::op_fx33(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
-  memory[I] = (V[x] / 100);
-  memory[I + 1] = (V[x] / 10) % 10;
-  memory[I + 2] = V[x] % 10;
+  write_byte(I, V[x] / 100);
+  write_byte(I + 1, (V[x] / 10) % 10);
+  write_byte(I + 2, V[x] % 10);
 }
 
 void Chip8::op_fx55(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
-  std::copy(V.begin(), V.begin() + x + 1, memory.begin() + I);
+  for (int i = 0; i <= x; ++i)
+  {
+    write_byte(I + i, V[i]);
+  }
 }
 
 void Chip8::op_fx65(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
 {
-  std::copy(memory.begin() + I, memory.begin() + I + x + 1, V.begin());
+  for (int i = 0; i <= x; ++i)
+  {
+    V[i] = read_byte(I + i);
+  }
+}
+
+void Chip8::op_fx75(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  std::copy(V.begin(), V.begin() + x + 1, flags.begin());
+}
+
+void Chip8::op_fx85(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val)
+{
+  std::copy(flags.begin(), flags.begin() + x + 1, V.begin());
 }
 
 /*
@@ -362,7 +823,7 @@ This requires 2 keys for lookup, use first byte, and if it can further diverge,
 Function pointer will be stored in an array of size 16 with unordered_maps
 */
 
-opcode_function Chip8::get_function(unsigned short opcode)
+const opcode_function& Chip8::get_function(unsigned short opcode)
 {
   //
   // START static function table declaration 
@@ -372,13 +833,24 @@ opcode_function Chip8::get_function(unsigned short opcode)
     std::unordered_map<short, opcode_function> {                                                                  // 0x0
       { 0x00e0, op_00e0 },
       { 0x00ee, op_00ee },
-      { 0x0000, op_0nnn }
+      { 0x0000, op_0nnn },
+      { 0x00c0, op_00cn },
+      { 0x00d0, op_00dn },
+      { 0x00fb, op_00fb },
+      { 0x00fc, op_00fc },
+      { 0x00fd, op_00fd },
+      { 0x00fe, op_00fe },
+      { 0x00ff, op_00ff }
     },
     std::unordered_map<short, opcode_function> {{ 0x0000, op_1nnn }},                                             // 0x1
     std::unordered_map<short, opcode_function> {{ 0x0000, op_2nnn }},                                             // 0x2
     std::unordered_map<short, opcode_function> {{ 0x0000, op_3xkk }},                                             // 0x3
     std::unordered_map<short, opcode_function> {{ 0x0000, op_4xkk }},                                             // 0x4
-    std::unordered_map<short, opcode_function> {{ 0x0000, op_5xy0 }},                                             // 0x5
+    std::unordered_map<short, opcode_function> {                                                                  // 0x5
+      { 0x0000, op_5xy0 },
+      { 0x0002, op_5xy2 },
+      { 0x0003, op_5xy3 }
+    },
     std::unordered_map<short, opcode_function> {{ 0x0000, op_6xkk }},                                             // 0x6
     std::unordered_map<short, opcode_function> {{ 0x0000, op_7xkk }},                                             // 0x7
     std::unordered_map<short, opcode_function> {                                                                  // 0x8
@@ -402,15 +874,22 @@ opcode_function Chip8::get_function(unsigned short opcode)
       { 0x00a1, op_exa1 }
     },                         
     std::unordered_map<short, opcode_function> {                                                                  // 0xf
+      { 0x0000, op_f000 },
+      { 0x0001, op_fn01 },
+      { 0x0002, op_f002 },
       { 0x0007, op_fx07 },
       { 0x000a, op_fx0a },
       { 0x0015, op_fx15 },
       { 0x0018, op_fx18 },
       { 0x001e, op_fx1e },
       { 0x0029, op_fx29 },
+      { 0x0030, op_fx30 },
       { 0x0033, op_fx33 },
+      { 0x003a, op_fx3a },
       { 0x0055, op_fx55 },
-      { 0x0065, op_fx65 }
+      { 0x0065, op_fx65 },
+      { 0x0075, op_fx75 },
+      { 0x0085, op_fx85 }
     }
   };
 
@@ -420,26 +899,54 @@ opcode_function Chip8::get_function(unsigned short opcode)
 
   unsigned short index = (opcode & 0xF000) >> 12;
   unsigned short map_key = 0x0000;
-  if (index == 0x0008)
+  if (index == 0x0005 || index == 0x0008)
     map_key = opcode & 0x000F;
   if (index == 0x000e || index == 0x000f)
     map_key = opcode & 0x00FF;
   if (index == 0x0000)
     map_key = opcode & 0xFFF;
+  if (index == 0x0000 && ((opcode & 0xFFF0) == 0x00C0 || (opcode & 0xFFF0) == 0x00D0)) // Scroll amount is in the last nibble
+    map_key = opcode & 0xFF0;
+
+  static const opcode_function default_function = op_default;
 
   auto func_iterator = op_table[index].find(map_key);
 
   if (func_iterator == op_table[index].end())
   {
-    return Chip8::op_default;
+    return default_function;
   }
 
   return func_iterator->second;
 }
 
+/*
+Compiled ROMs register themselves during static initialization, so the registry must exist before any of them
+*/
+std::unordered_map<unsigned int, native_function>& Chip8::native_registry()
+{
+  static std::unordered_map<unsigned int, native_function> registry;
+  return registry;
+}
+
+bool Chip8::register_native(unsigned int rom_hash, native_function function)
+{
+  native_registry()[rom_hash] = function;
+  return true;
+}
+
 void Chip8::emulate_cycle()
 {
-  unsigned short opcode = memory[pc] << 8 | memory[pc + 1];
+  if (native && native(1))
+  {
+    return;
+  }
+  interpret_cycle();
+}
+
+void Chip8::interpret_cycle()
+{
+  unsigned short opcode = read_byte(pc) << 8 | read_byte(pc + 1);
   unsigned char x = (0x0F00 & opcode) >> 8;
   unsigned char y = (0x00F0 & opcode) >> 4;
   unsigned char val = opcode & 0x00FF;
@@ -475,3 +982,23 @@ int Chip8::tick_timers()
 
   return ret;
 }
+
+/*
+Runs a whole display frame as fast as possible: the given number of CPU cycles followed by one timer tick.
+Used to replay frames, e.g. when netplay rolls back. Returns the same flags as tick_timers().
+*/
+int Chip8::run_frame(int cycles)
+{
+  int i = 0;
+  while (i < cycles)
+  {
+    int executed = native ? native(cycles - i) : 0;
+    if (!executed)
+    {
+      interpret_cycle();
+      executed = 1;
+    }
+    i += executed;
+  }
+  return tick_timers();
+}
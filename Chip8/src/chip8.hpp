@@ -2,19 +2,107 @@
 #define CHIP8_H
 
 #include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <unordered_map>
 
 #define CHIP8_SOUND_TIMER_NONZERO 0x1
 #define CHIP8_DELAY_TIMER_NONZERO 0x2
 #define CHIP8_ALL_TIMERS_ZERO 0x0
 
+#define CHIP8_VARIANT_CHIP8 0 // Original instruction set, 4 KB of memory, sprites wrap around the screen
+#define CHIP8_VARIANT_SCHIP 1 // SUPER-CHIP, 4 KB of memory, sprites are clipped
+#define CHIP8_VARIANT_XOCHIP 2 // XO-CHIP, 64 KB of memory, sprites are clipped
+
+#define CHIP8_MEMORY_SIZE 65536 // Largest memory of any variant, smaller ones wrap addresses earlier
+#define CHIP8_PAGE_SIZE 256
+#define CHIP8_PAGE_COUNT (CHIP8_MEMORY_SIZE / CHIP8_PAGE_SIZE)
+
+#define CHIP8_DISPLAY_WIDTH 128 // Hi-res size, low-res only uses the top left 64 x 32
+#define CHIP8_DISPLAY_HEIGHT 64
+#define CHIP8_LORES_WIDTH 64
+#define CHIP8_LORES_HEIGHT 32
+#define CHIP8_DISPLAY_PLANES 2
+#define CHIP8_ROW_WORDS (CHIP8_DISPLAY_WIDTH / 64) // 64-bit words per row in each plane
+
 using opcode_function = std::function<void(unsigned short, unsigned char, unsigned char, unsigned char)>;
 
+/*
+Entry point of a ROM compiled ahead of time by tools/chip8aot. Runs up to budget instructions natively
+starting at pc and returns how many it ran, 0 if pc is not compiled code and the interpreter has to step.
+*/
+using native_function = int (*)(int budget);
+
+/*
+Compiled ROMs specialize this with the hash of their ROM image, making them friends of Chip8
+*/
+template <unsigned int rom_hash>
+struct Chip8Native;
+
+/*
+FNV-1a hash of a ROM image, identifies compiled code for it
+*/
+inline unsigned int chip8_rom_hash(const unsigned char* data, std::size_t size)
+{
+  unsigned int hash = 2166136261u;
+  for (std::size_t i = 0; i < size; ++i)
+  {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+using memory_page = std::array<unsigned char, CHIP8_PAGE_SIZE>;
+
+/*
+One row of the display, packed 1 bit per pixel: plane p covers words [p * CHIP8_ROW_WORDS, (p + 1) * CHIP8_ROW_WORDS)
+and the most significant bit of a plane's first word is the leftmost pixel.
+*/
+using display_row = std::array<std::uint64_t, CHIP8_DISPLAY_PLANES * CHIP8_ROW_WORDS>;
+
+// RGB332 color for each combination of the two planes, plane 0 is the low bit
+static const unsigned char chip8_palette[4] = { 0x00, 0xFF, 0xF4, 0x6C };
+
+/*
+Full machine state, as returned by Chip8::save_state().
+Memory pages and display rows are reference counted and shared with the running machine,
+a page or row is only copied once either side writes to it. Taking or dropping a snapshot
+never copies memory or the framebuffer.
+*/
+struct Chip8State
+{
+  std::array<std::shared_ptr<memory_page>, CHIP8_PAGE_COUNT> memory;
+  std::array<std::shared_ptr<display_row>, CHIP8_DISPLAY_HEIGHT> graphics;
+  std::array<unsigned char, 16> V;
+  std::array<unsigned short, 16> stack;
+
+  unsigned short I;
+  unsigned short pc;
+  unsigned short sp;
+
+  unsigned char delay_timer;
+  unsigned char sound_timer;
+  unsigned char waiting_key;
+  unsigned int random_state;
+
+  bool hires;
+  unsigned char plane_mask;
+  std::array<unsigned char, 16> flags;
+  std::array<unsigned char, 16> audio_pattern;
+  unsigned char pitch;
+};
+
 class Chip8
 {
+  template <unsigned int rom_hash>
+  friend struct Chip8Native;
+
 private:
-  static std::array<unsigned char, 4096> memory;
+  static std::array<std::shared_ptr<memory_page>, CHIP8_PAGE_COUNT> memory;
   static std::array<unsigned char, 16> V;
   static std::array<unsigned short, 16> stack;
   
@@ -24,20 +112,69 @@ private:
 
   static unsigned char delay_timer;
   static unsigned char sound_timer;
+  static unsigned char waiting_key; // Key held down during Fx0A, 0xFF when none
+  static unsigned int random_state; // Cxkk generator, part of the machine state so replays are deterministic
+
+  static bool hires; // 128 x 64 mode, toggled by 00FF / 00FE
+  static unsigned char plane_mask; // Planes drawn, cleared and scrolled, selected by Fn01
+  static std::array<unsigned char, 16> flags; // Fx75 / Fx85 storage
+  static std::array<unsigned char, 16> audio_pattern; // Loaded by F002, kept for state accuracy but not played
+  static unsigned char pitch; // Set by Fx3A, kept for state accuracy but not played
+
+  static int variant;
+  static unsigned short memory_mask;
+
+  static native_function native; // Compiled code for the loaded ROM, if any
+  static std::bitset<CHIP8_MEMORY_SIZE> code_dirty; // Set for every instruction address whose bytes were written since load
   
   Chip8();
 
   static void reset();
 
+  static memory_page& writable_page(unsigned short address);
+  static display_row& writable_row(unsigned char row);
+
+  static unsigned char read_byte(unsigned short address)
+  {
+    address &= memory_mask;
+    return (*memory[address / CHIP8_PAGE_SIZE])[address % CHIP8_PAGE_SIZE];
+  }
+
+  static void write_byte(unsigned short address, unsigned char byte)
+  {
+    address &= memory_mask;
+    writable_page(address)[address % CHIP8_PAGE_SIZE] = byte;
+
+    // An instruction at address or address - 1 includes this byte, compiled code for either is now stale
+    code_dirty[address] = true;
+    code_dirty[(address - 1) & memory_mask] = true;
+  }
+
+  static void skip_instruction();
+  static bool all_planes_selected();
+  static void scroll_vertical(int rows);
+  static void scroll_horizontal(int pixels);
+
+  static std::unordered_map<unsigned int, native_function>& native_registry();
+
   static void op_default(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_0nnn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_00e0(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_00ee(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_00cn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_00dn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_00fb(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_00fc(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_00fd(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_00fe(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_00ff(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_1nnn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_2nnn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_3xkk(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_4xkk(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_5xy0(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_5xy2(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_5xy3(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_6xkk(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_7xkk(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_8xy0(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
@@ -56,30 +193,49 @@ private:
   static void op_dxyn(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_ex9e(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_exa1(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_f000(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_fn01(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_f002(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx07(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx0a(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx15(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx18(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx1e(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx29(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_fx30(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx33(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_fx3a(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx55(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
   static void op_fx65(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_fx75(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+  static void op_fx85(unsigned short opcode, unsigned char x, unsigned char y, unsigned char val);
+
+  static void interpret_cycle();
 
-  static opcode_function get_function(unsigned short opcode);
+  static const opcode_function& get_function(unsigned short opcode);
 
 
 public:
-  static std::array<unsigned char, 64 * 32> graphics;
+  static std::array<std::shared_ptr<display_row>, CHIP8_DISPLAY_HEIGHT> graphics;
   static std::array<unsigned char, 16> keys;
 
   static unsigned char render_flag; // Currently not used since display constantly renders at 60 Hz
 
   static Chip8& get();
 
+  static void set_variant(int machine_variant);
+  static int display_width();
+  static int display_height();
+
   static int load(const char* file_path);
   static void emulate_cycle();
   static int tick_timers();
+  static int run_frame(int cycles);
+
+  static Chip8State save_state();
+  static void restore_state(const Chip8State& state);
+
+  static bool register_native(unsigned int rom_hash, native_function function);
   
 };
 
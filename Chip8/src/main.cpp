@@ -1,9 +1,12 @@
 #include <SDL3/SDL.h>
 #include <iostream>
 #include <chrono>
+#include <string>
 
 #include "chip8.hpp"
 #include "audio.hpp"
+#include "stream.hpp"
+#include "netplay.hpp"
 
 unsigned char key_map[16] = {
   SDLK_X, // 0
@@ -24,22 +27,15 @@ unsigned char key_map[16] = {
   SDLK_V  // F
 };
 
-int main(int argc, char** argv)
+SDL_Renderer* create_display(const char* title)
 {
-  // Command usage, should take ROM file name
-  if (argc != 2) 
-  {
-    std::cout << "Usage: Chip8 <ROM file>" << std::endl;
-    return 1;
-  }
-
   // Initialize SDL window and renderer 
   SDL_Window* window = nullptr;
   SDL_Renderer* renderer = nullptr;
 
-  // 64 x 32 but is scaled by 10 because no devices are that low resolution nowadays
+  // 64 x 32 but is scaled by 10 because no devices are that low resolution nowadays, hi-res 128 x 64 fills the same window
   SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO);
-  SDL_CreateWindowAndRenderer("Chip-8", 640, 320, 0, &window, &renderer);
+  SDL_CreateWindowAndRenderer(title, 640, 320, 0, &window, &renderer);
   SDL_SetRenderScale(renderer, 10, 10);
 
   // Set render color to black, make canvas black
@@ -50,18 +46,167 @@ int main(int argc, char** argv)
   SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
   SDL_RenderPresent(renderer);
 
+  return renderer;
+}
+
+SDL_Texture* create_texture(SDL_Renderer* renderer, int width, int height)
+{
   // Set up texture for the graphics
   SDL_Texture* sdl_texture = SDL_CreateTexture(renderer,
     SDL_PIXELFORMAT_RGB332,
     SDL_TEXTUREACCESS_STREAMING,
-    64,
-    32);
+    width,
+    height);
   SDL_SetTextureScaleMode(sdl_texture, SDL_SCALEMODE_NEAREST);
+  return sdl_texture;
+}
+
+/*
+Spectator mode, shows the display of an emulator started with --serve
+*/
+int run_viewer(const char* address)
+{
+  Chip8StreamViewer viewer;
+  if (viewer.connect(address))
+  {
+    return 1;
+  }
+
+  SDL_Renderer* renderer = create_display("Chip-8 (spectating)");
+  SDL_Texture* sdl_texture = nullptr;
+  int texture_width = 0;
+  int texture_height = 0;
+
+  Chip8Audio chip8_audio = Chip8Audio::get();
+
+  SDL_Event sdl_event;
+
+  while (true)
+  {
+    while (SDL_PollEvent(&sdl_event))
+    {
+      if (sdl_event.type == SDL_EVENT_QUIT)
+      {
+        return 0;
+      }
+    }
+
+    int status = viewer.update(5);
+    if (status < 0)
+    {
+      std::cout << "Stream ended." << std::endl;
+      return 0;
+    }
+    if (status == 0)
+    {
+      continue;
+    }
+
+    if (viewer.width != texture_width || viewer.height != texture_height)
+    {
+      SDL_DestroyTexture(sdl_texture);
+      texture_width = viewer.width;
+      texture_height = viewer.height;
+      sdl_texture = create_texture(renderer, texture_width, texture_height);
+    }
+
+    if (viewer.sound)
+    {
+      chip8_audio.PlayBeep();
+    }
+
+    SDL_UpdateTexture(sdl_texture, NULL, viewer.graphics.data(), texture_width);
+    SDL_RenderTexture(renderer, sdl_texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+  }
+
+  return 0;
+}
+
+int print_usage()
+{
+  std::cout << "Usage: Chip8 <ROM file> [--variant <chip8 | schip | xochip>] [--serve <port | host:port | unix:path>] [--netplay <local host:port> <remote host:port>]" << std::endl;
+  std::cout << "       Chip8 --view <port | host:port | unix:path>" << std::endl;
+  return 1;
+}
+
+int main(int argc, char** argv)
+{
+  // Command usage, should take ROM file name and optional streaming/netplay addresses, or an address to spectate
+  if (argc == 3 && std::string(argv[1]) == "--view")
+  {
+    return run_viewer(argv[2]);
+  }
+  if (argc < 2)
+  {
+    return print_usage();
+  }
+
+  const char* serve_address = nullptr;
+  const char* netplay_local_address = nullptr;
+  const char* netplay_remote_address = nullptr;
+  for (int i = 2; i < argc; ++i)
+  {
+    std::string option = argv[i];
+    if (option == "--variant" && i + 1 < argc)
+    {
+      std::string variant = argv[++i];
+      if (variant == "chip8")
+      {
+        Chip8::set_variant(CHIP8_VARIANT_CHIP8);
+      }
+      else if (variant == "schip")
+      {
+        Chip8::set_variant(CHIP8_VARIANT_SCHIP);
+      }
+      else if (variant == "xochip")
+      {
+        Chip8::set_variant(CHIP8_VARIANT_XOCHIP);
+      }
+      else
+      {
+        return print_usage();
+      }
+    }
+    else if (option == "--serve" && i + 1 < argc)
+    {
+      serve_address = argv[++i];
+    }
+    else if (option == "--netplay" && i + 2 < argc)
+    {
+      netplay_local_address = argv[++i];
+      netplay_remote_address = argv[++i];
+    }
+    else
+    {
+      return print_usage();
+    }
+  }
+
+  bool serving = serve_address != nullptr;
+  if (serving && Chip8Stream::get().start(serve_address))
+  {
+    return 1;
+  }
+
+  SDL_Renderer* renderer = create_display("Chip-8");
+  SDL_Texture* sdl_texture = nullptr;
+  int texture_width = 0;
+  int texture_height = 0;
 
   Chip8 chip8 = Chip8::get();
 
   chip8.load(argv[1]);
 
+  // In netplay the machine is driven a whole frame at a time, local keys are only sent as input
+  bool netplay_enabled = netplay_local_address != nullptr;
+  Chip8Netplay netplay;
+  unsigned short local_keys = 0;
+  if (netplay_enabled && netplay.start(netplay_local_address, netplay_remote_address))
+  {
+    return 1;
+  }
+
   static const auto cpu_rate = std::chrono::nanoseconds{ 1000000000 / 540 };
   static const auto display_rate = std::chrono::nanoseconds{ 1000000000 / 60 };
 
@@ -83,7 +228,7 @@ int main(int argc, char** argv)
       }
       if (sdl_event.type == SDL_EVENT_KEY_DOWN)
       {
-        if (sdl_event.key.key == SDLK_F5) // Reset
+        if (sdl_event.key.key == SDLK_F5 && !netplay_enabled) // Reset, not possible in netplay since the peer would desync
         {
           chip8.load(argv[1]);
           break;
@@ -93,6 +238,7 @@ int main(int argc, char** argv)
           if (sdl_event.key.key == key_map[i])
           {
             chip8.keys[i] = 1;
+            local_keys |= 1 << i;
           }
         }
       }
@@ -103,6 +249,7 @@ int main(int argc, char** argv)
           if (sdl_event.key.key == key_map[i])
           {
             chip8.keys[i] = 0;
+            local_keys &= ~(1 << i);
           }
         }
       }
@@ -110,7 +257,7 @@ int main(int argc, char** argv)
 
     // Run single CPU cycle at CPU rate
     auto cpu_clock_end = std::chrono::steady_clock::now();
-    if (cpu_clock_end - cpu_clock_begin >= cpu_rate)
+    if (cpu_clock_end - cpu_clock_begin >= cpu_rate && !netplay_enabled)
     {
       cpu_clock_begin = cpu_clock_end;
       chip8.emulate_cycle();
@@ -126,12 +273,49 @@ int main(int argc, char** argv)
         chip8.render_flag = 0;
       }
 
-      if (chip8.tick_timers() & CHIP8_SOUND_TIMER_NONZERO)
+      int timers = netplay_enabled ? netplay.advance(local_keys) : chip8.tick_timers();
+      bool sound = !(timers & CHIP8_NETPLAY_WAITING) && (timers & CHIP8_SOUND_TIMER_NONZERO);
+      if (sound)
       {
         chip8_audio.PlayBeep();
       }
 
-      SDL_UpdateTexture(sdl_texture, NULL, chip8.graphics.data(), 64);
+      if (serving)
+      {
+        Chip8Stream::get().publish(chip8.graphics, chip8.display_width(), chip8.display_height(), sound);
+      }
+
+      // 00FE/00FF switch between 64 x 32 and 128 x 64, the texture always matches the current mode
+      if (chip8.display_width() != texture_width || chip8.display_height() != texture_height)
+      {
+        SDL_DestroyTexture(sdl_texture);
+        texture_width = chip8.display_width();
+        texture_height = chip8.display_height();
+        sdl_texture = create_texture(renderer, texture_width, texture_height);
+      }
+
+      // Display rows are packed bitplanes, expand each pixel's plane bits to its palette color
+      void* pixels;
+      int pitch;
+      if (SDL_LockTexture(sdl_texture, NULL, &pixels, &pitch))
+      {
+        for (int row = 0; row < texture_height; ++row)
+        {
+          const display_row& packed = *chip8.graphics[row];
+          unsigned char* out = static_cast<unsigned char*>(pixels) + row * pitch;
+          for (int x = 0; x < texture_width; ++x)
+          {
+            int shift = 63 - (x % 64);
+            int color = 0;
+            for (int plane = 0; plane < CHIP8_DISPLAY_PLANES; ++plane)
+            {
+              color |= ((packed[plane * CHIP8_ROW_WORDS + x / 64] >> shift) & 1) << plane;
+            }
+            out[x] = chip8_palette[color];
+          }
+        }
+        SDL_UnlockTexture(sdl_texture);
+      }
       SDL_RenderTexture(renderer, sdl_texture, NULL, NULL);
       SDL_RenderPresent(renderer);
     }
@@ -0,0 +1,306 @@
+#include "net.hpp"
+#include <iostream>
+#include <string>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#define poll WSAPoll
+using socklen_t = int;
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define NET_SEND_FLAGS MSG_NOSIGNAL // Closed viewers should not kill the emulator with SIGPIPE
+#else
+#define NET_SEND_FLAGS 0
+#endif
+
+/*
+Resolved form of an address string
+*/
+struct net_address
+{
+  sockaddr_storage storage;
+  socklen_t length;
+  bool is_unix;
+};
+
+static bool would_block()
+{
+#ifdef _WIN32
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EWOULDBLOCK || errno == EAGAIN;
+#endif
+}
+
+static bool set_nonblocking(net_socket socket)
+{
+#ifdef _WIN32
+  u_long mode = 1;
+  return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+  int flags = fcntl(socket, F_GETFL, 0);
+  return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+/*
+Parses "unix:/path", "host:port" or "port". A missing host means loopback.
+*/
+static bool resolve(const char* address, int socket_type, net_address& result)
+{
+  std::memset(&result, 0, sizeof(result));
+  std::string text = address;
+
+  if (text.rfind("unix:", 0) == 0)
+  {
+    sockaddr_un* unix_address = reinterpret_cast<sockaddr_un*>(&result.storage);
+    std::string path = text.substr(5);
+    if (path.empty() || path.size() >= sizeof(unix_address->sun_path))
+    {
+      std::cout << "Invalid Unix socket path: " << path << std::endl;
+      return false;
+    }
+    unix_address->sun_family = AF_UNIX;
+    std::memcpy(unix_address->sun_path, path.c_str(), path.size() + 1);
+    result.length = sizeof(sockaddr_un);
+    result.is_unix = true;
+    return true;
+  }
+
+  std::string host = "127.0.0.1";
+  std::string port = text;
+  size_t separator = text.rfind(':');
+  if (separator != std::string::npos)
+  {
+    host = text.substr(0, separator);
+    port = text.substr(separator + 1);
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = socket_type;
+
+  addrinfo* info = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0 || !info)
+  {
+    std::cout << "Could not resolve address: " << address << std::endl;
+    return false;
+  }
+
+  std::memcpy(&result.storage, info->ai_addr, info->ai_addrlen);
+  result.length = static_cast<socklen_t>(info->ai_addrlen);
+  result.is_unix = false;
+  freeaddrinfo(info);
+  return true;
+}
+
+bool net_startup()
+{
+#ifdef _WIN32
+  static bool started = false;
+  if (!started)
+  {
+    WSADATA wsa_data;
+    started = WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+  }
+  return started;
+#else
+  return true;
+#endif
+}
+
+net_socket net_listen(const char* address)
+{
+  net_address resolved;
+  if (!net_startup() || !resolve(address, SOCK_STREAM, resolved))
+  {
+    return NET_INVALID_SOCKET;
+  }
+
+  net_socket listener = socket(resolved.storage.ss_family, SOCK_STREAM, 0);
+  if (listener == NET_INVALID_SOCKET)
+  {
+    return NET_INVALID_SOCKET;
+  }
+
+  if (resolved.is_unix)
+  {
+    // A stale socket file from a previous run would make bind fail
+#ifdef _WIN32
+    DeleteFileA(reinterpret_cast<sockaddr_un*>(&resolved.storage)->sun_path);
+#else
+    unlink(reinterpret_cast<sockaddr_un*>(&resolved.storage)->sun_path);
+#endif
+  }
+  else
+  {
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+  }
+
+  if (bind(listener, reinterpret_cast<sockaddr*>(&resolved.storage), resolved.length) != 0 ||
+      listen(listener, 16) != 0 ||
+      !set_nonblocking(listener))
+  {
+    std::cout << "Failed to listen on " << address << std::endl;
+    net_close(listener);
+    return NET_INVALID_SOCKET;
+  }
+
+  return listener;
+}
+
+net_socket net_accept(net_socket listener)
+{
+  net_socket client = accept(listener, nullptr, nullptr);
+  if (client == NET_INVALID_SOCKET)
+  {
+    return NET_INVALID_SOCKET;
+  }
+
+  if (!set_nonblocking(client))
+  {
+    net_close(client);
+    return NET_INVALID_SOCKET;
+  }
+
+  return client;
+}
+
+net_socket net_connect(const char* address)
+{
+  net_address resolved;
+  if (!net_startup() || !resolve(address, SOCK_STREAM, resolved))
+  {
+    return NET_INVALID_SOCKET;
+  }
+
+  net_socket connection = socket(resolved.storage.ss_family, SOCK_STREAM, 0);
+  if (connection == NET_INVALID_SOCKET)
+  {
+    return NET_INVALID_SOCKET;
+  }
+
+  // Connect while still blocking, it is only done once at startup
+  if (connect(connection, reinterpret_cast<sockaddr*>(&resolved.storage), resolved.length) != 0 ||
+      !set_nonblocking(connection))
+  {
+    std::cout << "Failed to connect to " << address << std::endl;
+    net_close(connection);
+    return NET_INVALID_SOCKET;
+  }
+
+  if (!resolved.is_unix)
+  {
+    int no_delay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+  }
+
+  return connection;
+}
+
+net_socket net_udp(const char* local_address, const char* remote_address)
+{
+  net_address local;
+  net_address remote;
+  if (!net_startup() || !resolve(local_address, SOCK_DGRAM, local) || !resolve(remote_address, SOCK_DGRAM, remote))
+  {
+    return NET_INVALID_SOCKET;
+  }
+
+  if (local.is_unix || remote.is_unix)
+  {
+    std::cout << "Datagram sockets need host:port addresses" << std::endl;
+    return NET_INVALID_SOCKET;
+  }
+
+  net_socket datagram = socket(AF_INET, SOCK_DGRAM, 0);
+  if (datagram == NET_INVALID_SOCKET)
+  {
+    return NET_INVALID_SOCKET;
+  }
+
+  if (bind(datagram, reinterpret_cast<sockaddr*>(&local.storage), local.length) != 0 ||
+      connect(datagram, reinterpret_cast<sockaddr*>(&remote.storage), remote.length) != 0 ||
+      !set_nonblocking(datagram))
+  {
+    std::cout << "Failed to open " << local_address << " for " << remote_address << std::endl;
+    net_close(datagram);
+    return NET_INVALID_SOCKET;
+  }
+
+  return datagram;
+}
+
+void net_close(net_socket socket)
+{
+  if (socket == NET_INVALID_SOCKET)
+  {
+    return;
+  }
+#ifdef _WIN32
+  closesocket(socket);
+#else
+  close(socket);
+#endif
+}
+
+int net_send(net_socket socket, const void* data, std::size_t size)
+{
+  int sent = send(socket, static_cast<const char*>(data), static_cast<int>(size), NET_SEND_FLAGS);
+  if (sent < 0)
+  {
+    return would_block() ? 0 : -1;
+  }
+  return sent;
+}
+
+int net_recv(net_socket socket, void* data, std::size_t size)
+{
+  int received = recv(socket, static_cast<char*>(data), static_cast<int>(size), 0);
+  if (received == 0)
+  {
+    return -1; // Peer closed the connection
+  }
+  if (received < 0)
+  {
+    return would_block() ? 0 : -1;
+  }
+  return received;
+}
+
+int net_poll(std::vector<net_pollfd>& sockets, int timeout_ms)
+{
+  std::vector<pollfd> poll_sockets(sockets.size());
+  for (size_t i = 0; i < sockets.size(); ++i)
+  {
+    poll_sockets[i].fd = sockets[i].socket;
+    poll_sockets[i].events = (sockets[i].want_read ? POLLIN : 0) | (sockets[i].want_write ? POLLOUT : 0);
+    poll_sockets[i].revents = 0;
+  }
+
+  int ready = poll(poll_sockets.data(), static_cast<unsigned long>(poll_sockets.size()), timeout_ms);
+  for (size_t i = 0; i < sockets.size(); ++i)
+  {
+    short events = ready > 0 ? poll_sockets[i].revents : 0;
+    sockets[i].readable = events & (POLLIN | POLLHUP | POLLERR);
+    sockets[i].writable = events & POLLOUT;
+  }
+
+  return ready < 0 ? 0 : ready;
+}
@@ -0,0 +1,46 @@
+#ifndef CHIP8_NET_H
+#define CHIP8_NET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Thin wrapper over BSD sockets / Winsock so the rest of the emulator never includes platform headers.
+Addresses are strings: "port", "host:port" for TCP/UDP over IPv4, or "unix:/path" for a Unix domain socket.
+All sockets returned here are non-blocking.
+*/
+
+#ifdef _WIN32
+using net_socket = std::uintptr_t;
+#else
+using net_socket = int;
+#endif
+
+#define NET_INVALID_SOCKET (static_cast<net_socket>(~0))
+
+struct net_pollfd
+{
+  net_socket socket;
+  bool want_read;
+  bool want_write;
+  bool readable; // Also set on hang up or error, the following recv will report it
+  bool writable;
+};
+
+bool net_startup();
+
+net_socket net_listen(const char* address);
+net_socket net_accept(net_socket listener);
+net_socket net_connect(const char* address);
+net_socket net_udp(const char* local_address, const char* remote_address); // Bound and connected, send/recv move whole datagrams
+void net_close(net_socket socket);
+
+// Returns bytes transferred, 0 if the call would block, -1 if the connection is closed or failed
+int net_send(net_socket socket, const void* data, std::size_t size);
+int net_recv(net_socket socket, void* data, std::size_t size);
+
+// Waits up to timeout_ms for any socket to become ready, returns the number of ready sockets
+int net_poll(std::vector<net_pollfd>& sockets, int timeout_ms);
+
+#endif // CHIP8_NET_H
@@ -0,0 +1,188 @@
+#include "netplay.hpp"
+#include <algorithm>
+#include <iostream>
+
+#define NETPLAY_PACKET_HEADER_SIZE 9 // [first input frame: 4] [inputs of ours confirmed by sender: 4] [input count: 1]
+
+static void write_u32(unsigned char* data, unsigned int value)
+{
+  data[0] = static_cast<unsigned char>(value >> 24);
+  data[1] = static_cast<unsigned char>(value >> 16);
+  data[2] = static_cast<unsigned char>(value >> 8);
+  data[3] = static_cast<unsigned char>(value);
+}
+
+static unsigned int read_u32(const unsigned char* data)
+{
+  return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+Chip8Netplay::Chip8Netplay() : socket(NET_INVALID_SOCKET), frame(0), remote_confirmed(-1), remote_acknowledged(0), replayed_frames(0)
+{
+  local_inputs.fill(0);
+  remote_inputs.fill(0);
+  remote_input_frames.fill(-1);
+  used_remote_inputs.fill(0);
+}
+
+Chip8Netplay::~Chip8Netplay()
+{
+  net_close(socket);
+}
+
+/*
+Both sides must have loaded the same ROM before starting
+*/
+int Chip8Netplay::start(const char* local_address, const char* remote_address)
+{
+  socket = net_udp(local_address, remote_address);
+  if (socket == NET_INVALID_SOCKET)
+  {
+    return -1;
+  }
+
+  printf("Netplay on %s with peer %s \n", local_address, remote_address);
+  return 0;
+}
+
+/*
+Sends every input the peer has not confirmed yet, so a lost packet is covered by the next one
+*/
+void Chip8Netplay::send()
+{
+  std::array<unsigned char, NETPLAY_PACKET_HEADER_SIZE + 2 * CHIP8_NETPLAY_MAX_RESEND> packet;
+
+  int first = std::max(remote_acknowledged, frame - CHIP8_NETPLAY_MAX_RESEND);
+  int count = frame - first;
+
+  write_u32(packet.data(), first);
+  write_u32(packet.data() + 4, remote_confirmed + 1);
+  packet[8] = static_cast<unsigned char>(count);
+  for (int i = 0; i < count; ++i)
+  {
+    unsigned short input = local_inputs[(first + i) % CHIP8_NETPLAY_HISTORY];
+    packet[NETPLAY_PACKET_HEADER_SIZE + 2 * i] = input >> 8;
+    packet[NETPLAY_PACKET_HEADER_SIZE + 2 * i + 1] = input & 0xFF;
+  }
+
+  net_send(socket, packet.data(), NETPLAY_PACKET_HEADER_SIZE + 2 * count);
+}
+
+/*
+Reads all pending packets. Returns the earliest already run frame whose remote input was mispredicted,
+or the current frame if no rollback is needed.
+*/
+int Chip8Netplay::receive()
+{
+  int rollback_frame = frame;
+  std::array<unsigned char, NETPLAY_PACKET_HEADER_SIZE + 2 * CHIP8_NETPLAY_MAX_RESEND> packet;
+
+  for (int packets = 0; packets < CHIP8_NETPLAY_HISTORY; ++packets)
+  {
+    int size = net_recv(socket, packet.data(), packet.size());
+    if (size == 0)
+    {
+      break;
+    }
+    if (size < NETPLAY_PACKET_HEADER_SIZE) // Error reported for an earlier datagram, e.g. peer not started yet
+    {
+      continue;
+    }
+
+    int first = read_u32(packet.data());
+    int acknowledged = read_u32(packet.data() + 4);
+    int count = std::min<int>(packet[8], (size - NETPLAY_PACKET_HEADER_SIZE) / 2);
+
+    remote_acknowledged = std::max(remote_acknowledged, acknowledged);
+
+    for (int i = 0; i < count; ++i)
+    {
+      int input_frame = first + i;
+      int slot = input_frame % CHIP8_NETPLAY_HISTORY;
+      if (input_frame <= remote_confirmed || input_frame >= remote_confirmed + CHIP8_NETPLAY_HISTORY || remote_input_frames[slot] == input_frame)
+      {
+        continue;
+      }
+
+      unsigned short input = (packet[NETPLAY_PACKET_HEADER_SIZE + 2 * i] << 8) | packet[NETPLAY_PACKET_HEADER_SIZE + 2 * i + 1];
+      remote_inputs[slot] = input;
+      remote_input_frames[slot] = input_frame;
+
+      if (input_frame < frame && input != used_remote_inputs[slot])
+      {
+        rollback_frame = std::min(rollback_frame, input_frame);
+      }
+    }
+
+    while (remote_input_frames[(remote_confirmed + 1) % CHIP8_NETPLAY_HISTORY] == remote_confirmed + 1)
+    {
+      ++remote_confirmed;
+    }
+  }
+
+  return rollback_frame;
+}
+
+/*
+Remote input for a frame, predicted from the last confirmed one if it has not arrived
+*/
+unsigned short Chip8Netplay::remote_input(int input_frame)
+{
+  int slot = input_frame % CHIP8_NETPLAY_HISTORY;
+  if (remote_input_frames[slot] == input_frame)
+  {
+    return remote_inputs[slot];
+  }
+  if (remote_confirmed >= 0)
+  {
+    return remote_inputs[remote_confirmed % CHIP8_NETPLAY_HISTORY];
+  }
+  return 0;
+}
+
+int Chip8Netplay::run(int run_frame)
+{
+  int slot = run_frame % CHIP8_NETPLAY_HISTORY;
+  states[run_frame % states.size()] = Chip8::save_state();
+
+  used_remote_inputs[slot] = remote_input(run_frame);
+  unsigned short input = local_inputs[slot] | used_remote_inputs[slot];
+  for (int i = 0; i < 16; ++i)
+  {
+    Chip8::keys[i] = (input >> i) & 1;
+  }
+
+  return Chip8::run_frame(CHIP8_NETPLAY_CYCLES_PER_FRAME);
+}
+
+/*
+Runs one display frame with the given local input (bit n set when key n is down), replaying earlier frames
+first if the peer's input turned out different from the prediction. Should be called at 60 Hz.
+Returns the flags of tick_timers() for the new frame, or CHIP8_NETPLAY_WAITING if the peer is too far behind.
+*/
+int Chip8Netplay::advance(unsigned short local_input)
+{
+  int rollback_frame = receive();
+  if (rollback_frame < frame)
+  {
+    Chip8::restore_state(states[rollback_frame % states.size()]);
+    for (int replay_frame = rollback_frame; replay_frame < frame; ++replay_frame)
+    {
+      run(replay_frame);
+      ++replayed_frames;
+    }
+  }
+
+  if (frame > remote_confirmed + CHIP8_NETPLAY_MAX_ROLLBACK)
+  {
+    send();
+    return CHIP8_NETPLAY_WAITING;
+  }
+
+  local_inputs[frame % CHIP8_NETPLAY_HISTORY] = local_input;
+  int ret = run(frame);
+  ++frame;
+
+  send();
+  return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef CHIP8_NETPLAY_H
+#define CHIP8_NETPLAY_H
+
+#include <array>
+
+#include "chip8.hpp"
+#include "net.hpp"
+
+/*
+Two player rollback netplay. Each side sends its own 16 key input every frame over UDP and never waits
+for the peer: missing remote input is predicted to be the same as the last one received. When the real
+input turns out different, the machine is restored to the snapshot taken before that frame and the
+frames since are replayed, all within the current display frame.
+
+Inputs of both players are ORed into the shared keys array, so each player simply uses their own keys.
+*/
+
+#define CHIP8_NETPLAY_WAITING 0x4 // Returned by advance() when too far ahead of the peer, the frame was not run
+
+#define CHIP8_NETPLAY_CYCLES_PER_FRAME 9 // 540 Hz CPU over 60 Hz frames
+#define CHIP8_NETPLAY_MAX_ROLLBACK 8 // Frames we may run ahead of the last confirmed remote input
+#define CHIP8_NETPLAY_HISTORY 64 // Input history, must cover every input the peer has not acknowledged
+#define CHIP8_NETPLAY_MAX_RESEND 32 // Inputs repeated in each packet, covers lost packets
+
+class Chip8Netplay
+{
+private:
+  net_socket socket;
+
+  int frame; // Next frame to run
+  int remote_confirmed; // Last frame for which every remote input up to it is known
+  int remote_acknowledged; // Number of our inputs the peer has confirmed
+
+  std::array<unsigned short, CHIP8_NETPLAY_HISTORY> local_inputs;
+  std::array<unsigned short, CHIP8_NETPLAY_HISTORY> remote_inputs;
+  std::array<int, CHIP8_NETPLAY_HISTORY> remote_input_frames; // Frame each remote_inputs slot holds, -1 if empty
+  std::array<unsigned short, CHIP8_NETPLAY_HISTORY> used_remote_inputs; // What each frame was actually run with
+
+  std::array<Chip8State, CHIP8_NETPLAY_MAX_ROLLBACK + 2> states; // Machine state at the start of each recent frame
+
+  int receive();
+  void send();
+  unsigned short remote_input(int input_frame);
+  int run(int run_frame);
+
+public:
+  unsigned int replayed_frames; // Frames run again after a misprediction, for diagnostics
+
+  Chip8Netplay();
+  ~Chip8Netplay();
+
+  int start(const char* local_address, const char* remote_address);
+  int advance(unsigned short local_input);
+};
+
+#endif // CHIP8_NETPLAY_H
@@ -0,0 +1,418 @@
+#include "stream.hpp"
+#include <iostream>
+
+// START DECLARATIONS
+
+net_socket                                Chip8Stream::listener = NET_INVALID_SOCKET;
+std::vector<Chip8Stream::viewer>          Chip8Stream::viewers;
+std::mutex                                Chip8Stream::viewers_lock;
+std::thread                               Chip8Stream::server_thread;
+std::atomic<bool>                         Chip8Stream::running;
+
+std::vector<unsigned char>                Chip8Stream::last_frame;
+int                                       Chip8Stream::last_width;
+int                                       Chip8Stream::last_height;
+unsigned int                              Chip8Stream::frame_count;
+
+// END DECLARATIONS
+
+static void write_header(unsigned char type, unsigned char sound, size_t payload_size, stream_message& message)
+{
+  message.push_back(type);
+  message.push_back(sound);
+  message.push_back(static_cast<unsigned char>(payload_size >> 8));
+  message.push_back(static_cast<unsigned char>(payload_size & 0xFF));
+}
+
+std::vector<unsigned char> stream_pack_frame(const std::array<std::shared_ptr<display_row>, CHIP8_DISPLAY_HEIGHT>& graphics, int width, int height)
+{
+  int row_bytes = width / 8;
+  std::vector<unsigned char> frame(height * CHIP8_DISPLAY_PLANES * row_bytes);
+  unsigned char* out = frame.data();
+  for (int y = 0; y < height; ++y)
+  {
+    const display_row& row = *graphics[y];
+    for (int plane = 0; plane < CHIP8_DISPLAY_PLANES; ++plane)
+    {
+      for (int byte = 0; byte < row_bytes; ++byte)
+      {
+        *out++ = static_cast<unsigned char>(row[plane * CHIP8_ROW_WORDS + byte / 8] >> (56 - 8 * (byte % 8)));
+      }
+    }
+  }
+  return frame;
+}
+
+void stream_encode_keyframe(const std::vector<unsigned char>& frame, int width, int height, unsigned char sound, stream_message& message)
+{
+  message.clear();
+  write_header(CHIP8_STREAM_KEYFRAME, sound, frame.size() + 3, message);
+  message.push_back(static_cast<unsigned char>(width));
+  message.push_back(static_cast<unsigned char>(height));
+  message.push_back(CHIP8_DISPLAY_PLANES);
+  message.insert(message.end(), frame.begin(), frame.end());
+}
+
+void stream_encode_delta(const std::vector<unsigned char>& previous, const std::vector<unsigned char>& current, unsigned char sound, stream_message& message)
+{
+  message.clear();
+  write_header(CHIP8_STREAM_DELTA, sound, 0, message);
+
+  // Nothing is written for the unchanged tail of the frame
+  size_t end = current.size();
+  while (end > 0 && current[end - 1] == previous[end - 1])
+  {
+    --end;
+  }
+
+  size_t i = 0;
+  while (i < end)
+  {
+    unsigned char skip = 0;
+    while (i < end && current[i] == previous[i] && skip < 0xFF)
+    {
+      ++skip;
+      ++i;
+    }
+
+    size_t count_index = message.size() + 1;
+    unsigned char count = 0;
+    while (i < end && current[i] != previous[i] && count < 0xFF)
+    {
+      if (!count)
+      {
+        message.push_back(skip);
+        message.push_back(0);
+      }
+      message.push_back(current[i] ^ previous[i]);
+      ++count;
+      ++i;
+    }
+
+    if (count)
+    {
+      message[count_index] = count;
+    }
+    else // Run of unchanged bytes longer than 255
+    {
+      message.push_back(skip);
+      message.push_back(0);
+    }
+  }
+
+  size_t payload_size = message.size() - CHIP8_STREAM_HEADER_SIZE;
+  message[2] = static_cast<unsigned char>(payload_size >> 8);
+  message[3] = static_cast<unsigned char>(payload_size & 0xFF);
+}
+
+Chip8Stream& Chip8Stream::get()
+{
+  static Chip8Stream instance;
+  return instance;
+}
+
+Chip8Stream::Chip8Stream()
+{
+  running = false;
+  last_width = 0;
+  last_height = 0;
+  frame_count = 0;
+}
+
+Chip8Stream::~Chip8Stream()
+{
+  stop();
+}
+
+int Chip8Stream::start(const char* address)
+{
+  if (running)
+  {
+    return 0;
+  }
+
+  listener = net_listen(address);
+  if (listener == NET_INVALID_SOCKET)
+  {
+    return -1;
+  }
+
+  printf("Streaming display on %s \n", address);
+
+  running = true;
+  server_thread = std::thread(serve);
+  return 0;
+}
+
+void Chip8Stream::stop()
+{
+  if (!running)
+  {
+    return;
+  }
+
+  running = false;
+  server_thread.join();
+
+  for (viewer& client : viewers)
+  {
+    net_close(client.socket);
+  }
+  viewers.clear();
+  net_close(listener);
+  listener = NET_INVALID_SOCKET;
+}
+
+/*
+Encodes the frame once and queues it for every viewer. Never touches a socket, so a slow viewer
+can not stall the emulation thread. Should be called once per displayed frame.
+*/
+void Chip8Stream::publish(const std::array<std::shared_ptr<display_row>, CHIP8_DISPLAY_HEIGHT>& graphics, int width, int height, bool sound)
+{
+  if (!running)
+  {
+    return;
+  }
+
+  std::vector<unsigned char> frame = stream_pack_frame(graphics, width, height);
+  bool periodic_keyframe = frame_count++ % CHIP8_STREAM_KEYFRAME_INTERVAL == 0;
+
+  // No delta across a resolution change, every viewer gets a keyframe instead
+  std::shared_ptr<stream_message> delta;
+  std::shared_ptr<stream_message> keyframe;
+  bool resized = width != last_width || height != last_height;
+  if (!resized && last_frame.size() == frame.size())
+  {
+    delta = std::make_shared<stream_message>();
+    stream_encode_delta(last_frame, frame, sound, *delta);
+  }
+
+  std::lock_guard<std::mutex> guard(viewers_lock);
+  for (viewer& client : viewers)
+  {
+    if (client.queued_bytes > CHIP8_STREAM_MAX_BACKLOG)
+    {
+      // Viewer can not keep up, drop everything it has not started receiving and wait for a keyframe
+      while (client.queue.size() > (client.sent ? 1 : 0))
+      {
+        client.queued_bytes -= client.queue.back()->size();
+        client.queue.pop_back();
+      }
+      client.lagging = true;
+    }
+
+    if (client.needs_keyframe || resized || (client.lagging && periodic_keyframe))
+    {
+      if (!keyframe)
+      {
+        keyframe = std::make_shared<stream_message>();
+        stream_encode_keyframe(frame, width, height, sound, *keyframe);
+      }
+      client.queue.push_back(keyframe);
+      client.queued_bytes += keyframe->size();
+      client.needs_keyframe = false;
+      client.lagging = false;
+    }
+    else if (!client.lagging && delta)
+    {
+      client.queue.push_back(delta);
+      client.queued_bytes += delta->size();
+    }
+  }
+
+  last_frame.swap(frame);
+  last_width = width;
+  last_height = height;
+}
+
+/*
+Sends as much of the viewer's queue as the socket accepts without blocking
+*/
+void Chip8Stream::flush(viewer& client)
+{
+  std::lock_guard<std::mutex> guard(viewers_lock);
+  while (!client.queue.empty())
+  {
+    const stream_message& message = *client.queue.front();
+    int sent = net_send(client.socket, message.data() + client.sent, message.size() - client.sent);
+    if (sent < 0)
+    {
+      client.closed = true;
+      return;
+    }
+    if (sent == 0)
+    {
+      return;
+    }
+
+    client.sent += sent;
+    if (client.sent == message.size())
+    {
+      client.queued_bytes -= message.size();
+      client.queue.pop_front();
+      client.sent = 0;
+    }
+  }
+}
+
+/*
+Server thread, accepts viewers and drains their queues. Polls with a short timeout so freshly
+published frames go out within a few milliseconds.
+*/
+void Chip8Stream::serve()
+{
+  std::vector<net_pollfd> sockets;
+  unsigned char discard[256];
+
+  while (running)
+  {
+    sockets.clear();
+    sockets.push_back({ listener, true, false, false, false });
+    {
+      std::lock_guard<std::mutex> guard(viewers_lock);
+      for (viewer& client : viewers)
+      {
+        sockets.push_back({ client.socket, true, !client.queue.empty(), false, false });
+      }
+    }
+
+    net_poll(sockets, 4);
+
+    for (size_t i = 1; i < sockets.size(); ++i)
+    {
+      viewer& client = viewers[i - 1];
+      if (sockets[i].readable && net_recv(client.socket, discard, sizeof(discard)) < 0)
+      {
+        client.closed = true;
+      }
+      if (!client.closed)
+      {
+        flush(client);
+      }
+    }
+
+    std::lock_guard<std::mutex> guard(viewers_lock);
+    for (size_t i = 0; i < viewers.size();)
+    {
+      if (viewers[i].closed)
+      {
+        net_close(viewers[i].socket);
+        viewers.erase(viewers.begin() + i);
+      }
+      else
+      {
+        ++i;
+      }
+    }
+
+    if (sockets[0].readable)
+    {
+      net_socket socket = net_accept(listener);
+      if (socket != NET_INVALID_SOCKET)
+      {
+        viewers.push_back({ socket, {}, 0, 0, true, false, false });
+      }
+    }
+  }
+}
+
+Chip8StreamViewer::Chip8StreamViewer() : socket(NET_INVALID_SOCKET), has_keyframe(false), planes(0), width(0), height(0), sound(false)
+{
+}
+
+Chip8StreamViewer::~Chip8StreamViewer()
+{
+  net_close(socket);
+}
+
+int Chip8StreamViewer::connect(const char* address)
+{
+  socket = net_connect(address);
+  return socket == NET_INVALID_SOCKET ? -1 : 0;
+}
+
+void Chip8StreamViewer::apply(unsigned char type, const unsigned char* payload, size_t size)
+{
+  if (type == CHIP8_STREAM_KEYFRAME && size >= 3)
+  {
+    width = payload[0];
+    height = payload[1];
+    planes = payload[2];
+    frame.assign(payload + 3, payload + size);
+    frame.resize(height * planes * (width / 8), 0);
+    has_keyframe = true;
+  }
+  else if (type == CHIP8_STREAM_DELTA && has_keyframe)
+  {
+    size_t position = 0;
+    size_t i = 0;
+    while (i + 2 <= size)
+    {
+      position += payload[i];
+      unsigned char count = payload[i + 1];
+      i += 2;
+      for (unsigned char j = 0; j < count && i < size && position < frame.size(); ++j)
+      {
+        frame[position++] ^= payload[i++];
+      }
+    }
+  }
+  else
+  {
+    return;
+  }
+
+  int row_bytes = width / 8;
+  graphics.resize(width * height);
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      int color = 0;
+      for (int plane = 0; plane < planes && plane < CHIP8_DISPLAY_PLANES; ++plane)
+      {
+        if (frame[(y * planes + plane) * row_bytes + x / 8] & (0x80 >> (x % 8)))
+        {
+          color |= 1 << plane;
+        }
+      }
+      graphics[y * width + x] = chip8_palette[color];
+    }
+  }
+}
+
+/*
+Reads whatever the server has sent, waiting up to timeout_ms for data.
+Returns 1 if the display changed, 0 if not, -1 when the stream has ended.
+*/
+int Chip8StreamViewer::update(int timeout_ms)
+{
+  std::vector<net_pollfd> sockets = { { socket, true, false, false, false } };
+  net_poll(sockets, timeout_ms);
+
+  unsigned char chunk[4096];
+  int received;
+  while ((received = net_recv(socket, chunk, sizeof(chunk))) > 0)
+  {
+    buffer.insert(buffer.end(), chunk, chunk + received);
+  }
+
+  int ret = 0;
+  size_t offset = 0;
+  while (buffer.size() - offset >= CHIP8_STREAM_HEADER_SIZE)
+  {
+    size_t payload_size = (buffer[offset + 2] << 8) | buffer[offset + 3];
+    if (buffer.size() - offset < CHIP8_STREAM_HEADER_SIZE + payload_size)
+    {
+      break;
+    }
+
+    sound = buffer[offset + 1];
+    apply(buffer[offset], buffer.data() + offset + CHIP8_STREAM_HEADER_SIZE, payload_size);
+    offset += CHIP8_STREAM_HEADER_SIZE + payload_size;
+    ret = has_keyframe ? 1 : 0;
+  }
+  buffer.erase(buffer.begin(), buffer.begin() + offset);
+
+  return received < 0 ? -1 : ret;
+}
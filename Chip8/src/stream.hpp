@@ -0,0 +1,108 @@
+#ifndef CHIP8_STREAM_H
+#define CHIP8_STREAM_H
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chip8.hpp"
+#include "net.hpp"
+
+/*
+Spectator stream format, every message is:
+  [type: 1 byte] [sound: 1 byte] [payload length: 2 bytes, big endian] [payload]
+
+KEYFRAME payload is [width] [height] [planes] followed by the framebuffer packed 1 bit per pixel, MSB first,
+one row of each plane after the other. A keyframe is also sent whenever the resolution changes.
+DELTA payload is the previous packed frame XORed with the current one, run length encoded as
+repeated [unchanged bytes to skip] [changed byte count] [changed bytes...]. An idle frame has an empty payload.
+*/
+
+#define CHIP8_STREAM_KEYFRAME 0x00
+#define CHIP8_STREAM_DELTA 0x01
+#define CHIP8_STREAM_HEADER_SIZE 4
+
+#define CHIP8_STREAM_KEYFRAME_INTERVAL 60 // Lagging viewers resynchronize on the next periodic keyframe
+#define CHIP8_STREAM_MAX_BACKLOG 8192 // Bytes queued for a viewer before it is considered lagging
+
+using stream_message = std::vector<unsigned char>;
+
+std::vector<unsigned char> stream_pack_frame(const std::array<std::shared_ptr<display_row>, CHIP8_DISPLAY_HEIGHT>& graphics, int width, int height);
+void stream_encode_keyframe(const std::vector<unsigned char>& frame, int width, int height, unsigned char sound, stream_message& message);
+void stream_encode_delta(const std::vector<unsigned char>& previous, const std::vector<unsigned char>& current, unsigned char sound, stream_message& message);
+
+/*
+Serves the running machine's display to any number of viewers.
+publish() is called from the emulation thread and only encodes and queues, all socket work happens on the server thread.
+*/
+class Chip8Stream
+{
+private:
+  struct viewer
+  {
+    net_socket socket;
+    std::deque<std::shared_ptr<const stream_message>> queue;
+    size_t sent; // Bytes of the front message already sent
+    size_t queued_bytes;
+    bool needs_keyframe; // Newly connected, gets a keyframe with the next published frame
+    bool lagging; // Backlog was dropped, waits for the next periodic keyframe
+    bool closed;
+  };
+
+  static net_socket listener;
+  static std::vector<viewer> viewers;
+  static std::mutex viewers_lock;
+  static std::thread server_thread;
+  static std::atomic<bool> running;
+
+  static std::vector<unsigned char> last_frame;
+  static int last_width;
+  static int last_height;
+  static unsigned int frame_count;
+
+  Chip8Stream();
+  ~Chip8Stream();
+
+  static void serve();
+  static void flush(viewer& client);
+
+public:
+  static Chip8Stream& get();
+
+  static int start(const char* address);
+  static void stop();
+  static void publish(const std::array<std::shared_ptr<display_row>, CHIP8_DISPLAY_HEIGHT>& graphics, int width, int height, bool sound);
+};
+
+/*
+Client side of the stream, keeps an unpacked copy of the remote display
+*/
+class Chip8StreamViewer
+{
+private:
+  net_socket socket;
+  std::vector<unsigned char> buffer;
+  std::vector<unsigned char> frame;
+  bool has_keyframe;
+  unsigned char planes;
+
+  void apply(unsigned char type, const unsigned char* payload, size_t size);
+
+public:
+  unsigned char width;
+  unsigned char height;
+  std::vector<unsigned char> graphics; // One RGB332 byte per pixel from chip8_palette, like the emulator display
+  bool sound;
+
+  Chip8StreamViewer();
+  ~Chip8StreamViewer();
+
+  int connect(const char* address);
+  int update(int timeout_ms);
+};
+
+#endif // CHIP8_STREAM_H
@@ -0,0 +1,392 @@
+/*
+chip8aot: ahead of time compiler for Chip-8 ROMs.
+
+Walks the control flow of a ROM from 0x200 and writes a C++ source file with every reachable instruction
+turned into straight-line code against the Chip8 machine state. Compile the output together with the
+emulator sources and it is used automatically whenever that exact ROM is loaded.
+
+Jumps and calls to known addresses become gotos. Returns, Bnnn and anything else with a target only known
+at run time go through a switch over all compiled addresses. Whenever pc leaves the compiled code, or an
+instruction's bytes have been overwritten by the program, control falls back to the interpreter.
+
+Usage: chip8aot <ROM file> <output .cpp file>
+*/
+
+#include "../src/chip8.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+static std::vector<unsigned char> rom;
+
+static bool in_rom(unsigned int address)
+{
+  return address >= 0x200 && address + 1 < 0x200 + rom.size();
+}
+
+static unsigned short fetch(unsigned int address)
+{
+  return rom[address - 0x200] << 8 | rom[address - 0x200 + 1];
+}
+
+/*
+Handler the interpreter would run for the opcode, mirrors Chip8::get_function
+*/
+static std::string handler_name(unsigned short opcode)
+{
+  static const char* single_handlers[16] = {
+    nullptr, "op_1nnn", "op_2nnn", "op_3xkk", "op_4xkk", nullptr, "op_6xkk", "op_7xkk",
+    nullptr, "op_9xy0", "op_annn", "op_bnnn", "op_cxkk", "op_dxyn", nullptr, nullptr
+  };
+
+  unsigned short index = (opcode & 0xF000) >> 12;
+  if (single_handlers[index])
+  {
+    return single_handlers[index];
+  }
+
+  switch (index)
+  {
+  case 0x0:
+    switch (opcode & 0x0FFF)
+    {
+    case 0x0E0: return "op_00e0";
+    case 0x0EE: return "op_00ee";
+    case 0x000: return "op_0nnn";
+    case 0x0FB: return "op_00fb";
+    case 0x0FC: return "op_00fc";
+    case 0x0FD: return "op_00fd";
+    case 0x0FE: return "op_00fe";
+    case 0x0FF: return "op_00ff";
+    }
+    switch (opcode & 0x0FF0)
+    {
+    case 0x0C0: return "op_00cn";
+    case 0x0D0: return "op_00dn";
+    }
+    break;
+  case 0x5:
+    switch (opcode & 0x000F)
+    {
+    case 0x0: return "op_5xy0";
+    case 0x2: return "op_5xy2";
+    case 0x3: return "op_5xy3";
+    }
+    break;
+  case 0x8:
+    switch (opcode & 0x000F)
+    {
+    case 0x0: return "op_8xy0";
+    case 0x1: return "op_8xy1";
+    case 0x2: return "op_8xy2";
+    case 0x3: return "op_8xy3";
+    case 0x4: return "op_8xy4";
+    case 0x5: return "op_8xy5";
+    case 0x6: return "op_8xy6";
+    case 0x7: return "op_8xy7";
+    case 0x8: return "op_8xye";
+    }
+    break;
+  case 0xE:
+    switch (opcode & 0x00FF)
+    {
+    case 0x9E: return "op_ex9e";
+    case 0xA1: return "op_exa1";
+    }
+    break;
+  case 0xF:
+    switch (opcode & 0x00FF)
+    {
+    case 0x00: return "op_f000";
+    case 0x01: return "op_fn01";
+    case 0x02: return "op_f002";
+    case 0x07: return "op_fx07";
+    case 0x0A: return "op_fx0a";
+    case 0x15: return "op_fx15";
+    case 0x18: return "op_fx18";
+    case 0x1E: return "op_fx1e";
+    case 0x29: return "op_fx29";
+    case 0x30: return "op_fx30";
+    case 0x33: return "op_fx33";
+    case 0x3A: return "op_fx3a";
+    case 0x55: return "op_fx55";
+    case 0x65: return "op_fx65";
+    case 0x75: return "op_fx75";
+    case 0x85: return "op_fx85";
+    }
+    break;
+  }
+
+  return "op_default";
+}
+
+static bool is_skip(const std::string& handler)
+{
+  return handler == "op_3xkk" || handler == "op_4xkk" || handler == "op_5xy0" || handler == "op_9xy0" ||
+         handler == "op_ex9e" || handler == "op_exa1";
+}
+
+/*
+XO-CHIP's F000 NNNN is 4 bytes long, skips step over all of it when running as XO-CHIP
+*/
+static bool is_long(unsigned int address)
+{
+  return in_rom(address) && fetch(address) == 0xF000;
+}
+
+/*
+Every instruction address reachable from 0x200 through statically known control flow
+*/
+static std::set<unsigned short> find_reachable()
+{
+  std::set<unsigned short> reachable;
+  std::vector<unsigned short> pending = { 0x200 };
+
+  while (!pending.empty())
+  {
+    unsigned short address = pending.back();
+    pending.pop_back();
+    if (!in_rom(address) || reachable.count(address))
+    {
+      continue;
+    }
+    reachable.insert(address);
+
+    unsigned short opcode = fetch(address);
+    std::string handler = handler_name(opcode);
+    unsigned short nnn = opcode & 0x0FFF;
+
+    if (handler == "op_1nnn" || handler == "op_0nnn")
+    {
+      pending.push_back(nnn);
+    }
+    else if (handler == "op_2nnn")
+    {
+      pending.push_back(nnn);
+      pending.push_back(address + 2); // Return address
+    }
+    else if (is_skip(handler))
+    {
+      pending.push_back(address + 2);
+      pending.push_back(address + 4);
+      if (is_long(address + 2)) // Skipped length depends on the variant
+      {
+        pending.push_back(address + 6);
+      }
+    }
+    else if (handler == "op_f000")
+    {
+      pending.push_back(address + 4); // NNNN is data
+    }
+    else if (handler != "op_00ee" && handler != "op_bnnn" && handler != "op_00fd") // Computed targets, resolved at run time
+    {
+      pending.push_back(address + 2);
+    }
+  }
+
+  return reachable;
+}
+
+static std::string hex(unsigned int value, int digits)
+{
+  char text[16];
+  snprintf(text, sizeof(text), "0x%0*X", digits, value);
+  return text;
+}
+
+static std::string label(unsigned short address)
+{
+  char text[16];
+  snprintf(text, sizeof(text), "op_%03X", address);
+  return text;
+}
+
+/*
+Continues at target, natively if it was compiled, otherwise in the interpreter
+*/
+static std::string jump(unsigned short target, const std::set<unsigned short>& compiled)
+{
+  if (compiled.count(target))
+  {
+    return "goto " + label(target) + ";";
+  }
+  return "Chip8::pc = " + hex(target, 3) + "; return executed;";
+}
+
+static void emit_instruction(std::ostream& out, unsigned short address, const std::set<unsigned short>& compiled)
+{
+  unsigned short opcode = fetch(address);
+  std::string handler = handler_name(opcode);
+  std::string x = hex((opcode & 0x0F00) >> 8, 1);
+  std::string y = hex((opcode & 0x00F0) >> 4, 1);
+  std::string kk = hex(opcode & 0x00FF, 2);
+  std::string nnn = hex(opcode & 0x0FFF, 3);
+  std::string next = hex(address + 2, 3);
+
+  // Skips and F000 also depend on the following word, fall back if that was overwritten as well
+  std::string dirty = "Chip8::code_dirty[" + hex(address, 3) + "]";
+  if ((is_skip(handler) || handler == "op_f000") && address + 2 < CHIP8_MEMORY_SIZE)
+  {
+    dirty += " || Chip8::code_dirty[" + hex(address + 2, 3) + "]";
+  }
+
+  out << label(address) << ": // " << hex(opcode, 4) << "\n";
+  out << "  if (executed == budget || " << dirty << ") { Chip8::pc = " << hex(address, 3) << "; return executed; }\n";
+  out << "  ++executed;\n";
+
+  // Control flow
+  if (handler == "op_1nnn" || handler == "op_0nnn")
+  {
+    out << "  " << jump(opcode & 0x0FFF, compiled) << "\n";
+    return;
+  }
+  if (handler == "op_2nnn")
+  {
+    out << "  Chip8::stack[Chip8::sp] = " << next << ";\n";
+    out << "  Chip8::sp++;\n";
+    out << "  " << jump(opcode & 0x0FFF, compiled) << "\n";
+    return;
+  }
+  if (handler == "op_00ee")
+  {
+    out << "  Chip8::sp--;\n";
+    out << "  Chip8::pc = Chip8::stack[Chip8::sp];\n";
+    out << "  goto dispatch;\n";
+    return;
+  }
+  if (handler == "op_bnnn")
+  {
+    out << "  Chip8::pc = " << nnn << " + Chip8::V[0];\n";
+    out << "  goto dispatch;\n";
+    return;
+  }
+  if (handler == "op_fx0a" || handler == "op_00fd" || // Rewind pc while waiting for a key, or forever
+      (handler == "op_f000" && !in_rom(address + 2)) ||
+      (is_skip(handler) && is_long(address + 2))) // Skip length depends on the variant
+  {
+    out << "  Chip8::pc = " << next << ";\n";
+    out << "  Chip8::" << handler << "(" << hex(opcode, 4) << ", " << x << ", " << y << ", " << kk << ");\n";
+    out << "  goto dispatch;\n";
+    return;
+  }
+
+  if (is_skip(handler))
+  {
+    std::string condition;
+    if (handler == "op_3xkk") condition = "Chip8::V[" + x + "] == " + kk;
+    if (handler == "op_4xkk") condition = "Chip8::V[" + x + "] != " + kk;
+    if (handler == "op_5xy0") condition = "Chip8::V[" + x + "] != " + kk; // Same condition as Chip8::op_5xy0
+    if (handler == "op_9xy0") condition = "Chip8::V[" + x + "] != Chip8::V[" + y + "]";
+    if (handler == "op_ex9e") condition = "Chip8::keys[Chip8::V[" + x + "]]";
+    if (handler == "op_exa1") condition = "!Chip8::keys[Chip8::V[" + x + "]]";
+    out << "  if (" << condition << ") { " << jump(address + 4, compiled) << " }\n";
+  }
+  else if (handler == "op_6xkk")
+  {
+    out << "  Chip8::V[" << x << "] = " << kk << ";\n";
+  }
+  else if (handler == "op_7xkk")
+  {
+    out << "  Chip8::V[" << x << "] += " << kk << ";\n";
+  }
+  else if (handler == "op_8xy0")
+  {
+    out << "  Chip8::V[" << x << "] = Chip8::V[" << y << "];\n";
+  }
+  else if (handler == "op_8xy1")
+  {
+    out << "  Chip8::V[" << x << "] |= Chip8::V[" << y << "];\n";
+  }
+  else if (handler == "op_8xy2")
+  {
+    out << "  Chip8::V[" << x << "] &= Chip8::V[" << y << "];\n";
+  }
+  else if (handler == "op_8xy3")
+  {
+    out << "  Chip8::V[" << x << "] ^= Chip8::V[" << y << "];\n";
+  }
+  else if (handler == "op_annn")
+  {
+    out << "  Chip8::I = " << nnn << ";\n";
+  }
+  else if (handler == "op_f000")
+  {
+    out << "  Chip8::I = " << hex(fetch(address + 2), 4) << ";\n";
+    out << "  " << jump(address + 4, compiled) << "\n";
+    return;
+  }
+  else if (handler != "op_default")
+  {
+    out << "  Chip8::" << handler << "(" << hex(opcode, 4) << ", " << x << ", " << y << ", " << kk << ");\n";
+  }
+
+  // Fall through to the next instruction, unless it was not compiled right after this one
+  if (!compiled.count(address + 2) || *compiled.upper_bound(address) != address + 2)
+  {
+    out << "  " << jump(address + 2, compiled) << "\n";
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 3)
+  {
+    std::cout << "Usage: chip8aot <ROM file> <output .cpp file>" << std::endl;
+    return 1;
+  }
+
+  std::ifstream file(argv[1], std::ios::binary);
+  rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  if (rom.empty() || rom.size() > CHIP8_MEMORY_SIZE - 0x200)
+  {
+    std::cout << "ROM too big to fit in memory, or does not exist." << std::endl;
+    return 1;
+  }
+
+  std::set<unsigned short> compiled = find_reachable();
+  std::string rom_hash = hex(chip8_rom_hash(rom.data(), rom.size()), 8) + "u";
+  std::string native = "Chip8Native<" + rom_hash + ">";
+
+  std::ofstream out(argv[2]);
+  std::string rom_name = argv[1];
+  rom_name = rom_name.substr(rom_name.find_last_of("/\\") + 1);
+
+  out << "// Generated by chip8aot from " << rom_name << " (" << rom.size() << " bytes), do not edit.\n";
+  out << "// Used automatically when this exact ROM is loaded.\n\n";
+  out << "#include \"chip8.hpp\"\n\n";
+  out << "template <>\n";
+  out << "struct " << native << "\n";
+  out << "{\n";
+  out << "  static int run(int budget);\n";
+  out << "};\n\n";
+  out << "int " << native << "::run(int budget)\n";
+  out << "{\n";
+  out << "  int executed = 0;\n\n";
+  out << "dispatch:\n";
+  out << "  switch (Chip8::pc)\n";
+  out << "  {\n";
+  for (unsigned short address : compiled)
+  {
+    out << "  case " << hex(address, 3) << ": goto " << label(address) << ";\n";
+  }
+  out << "  default: return executed;\n";
+  out << "  }\n\n";
+  for (unsigned short address : compiled)
+  {
+    emit_instruction(out, address, compiled);
+  }
+  out << "}\n\n";
+  out << "static const bool registered = Chip8::register_native(" << rom_hash << ", " << native << "::run);\n";
+
+  if (!out)
+  {
+    std::cout << "Failed to write " << argv[2] << std::endl;
+    return 1;
+  }
+
+  printf("Compiled %zu instructions reachable from 0x200 into %s \n", compiled.size(), argv[2]);
+  return 0;
+}